@@ -4,6 +4,11 @@
 #include <sstream>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <sched.h>
+#include <linux/filter.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -14,11 +19,40 @@
 #include <array>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/sendfile.h>
+#include <csignal>
+#include <climits>
 #include <expected>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <unordered_map>
+#include <new>
+#include <ctime>
+#include <cctype>
+#include <functional>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <optional>
 
 class SafeFD {
 public:
     SafeFD(int fd = -1) : fd_(fd) {}
+    SafeFD(const SafeFD&) = delete;
+    SafeFD& operator=(const SafeFD&) = delete;
+    SafeFD(SafeFD&& other) noexcept : fd_(other.fd_) { other.fd_ = -1; }
+    SafeFD& operator=(SafeFD&& other) noexcept {
+        if (this != &other) {
+            if (fd_ != -1) {
+                close(fd_);
+            }
+            fd_ = other.fd_;
+            other.fd_ = -1;
+        }
+        return *this;
+    }
     ~SafeFD() {
         if (fd_ != -1) {
             close(fd_);
@@ -38,6 +72,27 @@ std::string base_path;
 bool check_file_size = false;
 
 const size_t tam_buffer = 256;
+const size_t max_request_size = 64 * 1024;
+const size_t max_batch_files = 256;
+const std::string batch_boundary = "docserver-batch-7f3a9c";
+const char* const listen_fds_env = "DOCSERVER_LISTEN_FDS";
+const char* const ready_fd_env = "DOCSERVER_READY_FD";
+const int client_timeout_seconds = 10;
+const int drain_timeout_seconds = 30;
+const int upgrade_timeout_seconds = 10;
+
+std::vector<std::string> listen_specs;
+size_t workers = 1;
+bool pin_cpus = false;
+std::string warmup_source;
+size_t warmup_budget = 256 * 1024 * 1024;
+int access_log_fd = -1;
+std::string listing_cache_dir;
+
+volatile sig_atomic_t shutdown_requested = 0;
+volatile sig_atomic_t upgrade_requested = 0;
+volatile sig_atomic_t stats_requested = 0;
+sigset_t original_mask;
 
 void send_response(int client_sock, std::string_view header, std::string_view body = {}) {
     std::string response = std::string(header) + "\r\n\r\n" + std::string(body);
@@ -47,28 +102,634 @@ void send_response(int client_sock, std::string_view header, std::string_view bo
     send(client_sock, response.c_str(), response.size(), 0);
 }
 
-std::string read_file(const std::string& path) {
+bool send_all(int client_sock, std::string_view data) {
+    while (!data.empty()) {
+        ssize_t sent = send(client_sock, data.data(), data.size(), MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data.remove_prefix(sent);
+    }
+    return true;
+}
+
+bool send_file(int client_sock, int file_fd, off_t size) {
+    off_t offset = 0;
+    while (offset < size) {
+        ssize_t sent = sendfile(client_sock, file_fd, &offset, size - offset);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (sent == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct opened_file {
+    SafeFD fd;
+    off_t size;
+};
+
+std::expected<opened_file, int> open_file(const std::string& path) {
     SafeFD file_fd(open(path.c_str(), O_RDONLY));
     if (!file_fd.is_valid()) {
-        return {};
+        return std::unexpected(errno);
     }
 
     struct stat file_stat;
     if (fstat(file_fd.value(), &file_stat) == -1) {
+        return std::unexpected(errno);
+    }
+
+    if (S_ISDIR(file_stat.st_mode)) {
+        return std::unexpected(EISDIR);
+    }
+
+    return opened_file{std::move(file_fd), file_stat.st_size};
+}
+
+std::string read_file(const std::string& path) {
+    auto file = open_file(path);
+    if (!file) {
         return {};
     }
 
-    void* mapped_memory = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, file_fd.value(), 0);
+    void* mapped_memory = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, file->fd.value(), 0);
     if (mapped_memory == MAP_FAILED) {
         return {};
     }
 
-    std::string body(static_cast<char*>(mapped_memory), file_stat.st_size);
-    munmap(mapped_memory, file_stat.st_size);
+    std::string body(static_cast<char*>(mapped_memory), file->size);
+    munmap(mapped_memory, file->size);
 
     return body;
 }
 
+std::string url_decode(std::string_view value, bool plus_as_space = true) {
+    std::string decoded;
+    decoded.reserve(value.size());
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (value[i] == '%' && i + 2 < value.size() && isxdigit(static_cast<unsigned char>(value[i + 1]))
+            && isxdigit(static_cast<unsigned char>(value[i + 2]))) {
+            char hex[3] = {value[i + 1], value[i + 2], 0};
+            decoded += static_cast<char>(std::strtol(hex, nullptr, 16));
+            i += 2;
+            continue;
+        }
+        decoded += plus_as_space && value[i] == '+' ? ' ' : value[i];
+    }
+    return decoded;
+}
+
+std::optional<std::string> query_param(std::string_view query, std::string_view name) {
+    while (!query.empty()) {
+        auto amp = query.find('&');
+        std::string_view param = query.substr(0, amp);
+        auto eq = param.find('=');
+        if (param.substr(0, eq) == name) {
+            return eq == std::string_view::npos ? std::string{} : url_decode(param.substr(eq + 1));
+        }
+        query = amp == std::string_view::npos ? std::string_view{} : query.substr(amp + 1);
+    }
+    return std::nullopt;
+}
+
+bool has_dot_dot_segment(std::string_view path) {
+    while (!path.empty()) {
+        auto slash = path.find('/');
+        if (path.substr(0, slash) == "..") {
+            return true;
+        }
+        path = slash == std::string_view::npos ? std::string_view{} : path.substr(slash + 1);
+    }
+    return false;
+}
+
+// Rutas pedidas a /__batch: parámetros "f" de la query y, en un POST, una ruta por línea del cuerpo.
+std::vector<std::string> parse_batch_paths(std::string_view target, std::string_view body) {
+    std::vector<std::string> paths;
+
+    auto query_pos = target.find('?');
+    if (query_pos != std::string_view::npos) {
+        std::string_view query = target.substr(query_pos + 1);
+        while (!query.empty()) {
+            auto amp = query.find('&');
+            std::string_view param = query.substr(0, amp);
+            if (param.starts_with("f=")) {
+                paths.push_back(url_decode(param.substr(2)));
+            }
+            query = amp == std::string_view::npos ? std::string_view{} : query.substr(amp + 1);
+        }
+    }
+
+    while (!body.empty()) {
+        auto eol = body.find('\n');
+        std::string_view line = body.substr(0, eol);
+        if (line.ends_with('\r')) {
+            line.remove_suffix(1);
+        }
+        if (!line.empty()) {
+            paths.emplace_back(line);
+        }
+        body = eol == std::string_view::npos ? std::string_view{} : body.substr(eol + 1);
+    }
+
+    return paths;
+}
+
+struct batch_part {
+    std::string path;
+    std::string header;
+    std::string error_body;
+    std::expected<opened_file, int> file;
+};
+
+// Una parte multipart/mixed por archivo, cada una con su propio Status; el contenido va por sendfile.
+bool send_batch(int client_sock, const std::vector<std::string>& paths) {
+    std::vector<batch_part> parts;
+    parts.reserve(paths.size());
+    size_t content_length = 0;
+
+    for (const auto& path : paths) {
+        batch_part part{path, {}, {}, std::unexpected(EINVAL)};
+        std::string status = "400 Bad Request";
+        bool valid_path = !path.empty() && path[0] == '/' && path.find_first_of(std::string_view("\r\n\0", 3)) == std::string::npos;
+        if (valid_path && has_dot_dot_segment(path)) {
+            status = "403 Forbidden";
+            part.error_body = "Acceso denegado.";
+        } else if (valid_path) {
+            part.file = open_file(base_path + path);
+            if (part.file) {
+                status = "200 OK";
+            } else if (part.file.error() == ENOENT || part.file.error() == EISDIR) {
+                status = "404 Not Found";
+                part.error_body = "Archivo no encontrado.";
+            } else if (part.file.error() == EACCES) {
+                status = "403 Forbidden";
+                part.error_body = "Acceso denegado.";
+            } else {
+                status = "500 Internal Server Error";
+                part.error_body = "Error interno del servidor.";
+            }
+        } else {
+            part.error_body = "Solicitud no válida.";
+        }
+
+        off_t part_size = part.file ? part.file->size : static_cast<off_t>(part.error_body.size());
+        std::ostringstream header;
+        header << "--" << batch_boundary << "\r\n";
+        if (valid_path) {
+            header << "Content-Location: " << path << "\r\n";
+        }
+        header << "Status: " << status << "\r\n"
+               << "Content-Length: " << part_size << "\r\n\r\n";
+        part.header = header.str();
+
+        content_length += part.header.size() + part_size + 2;
+        parts.push_back(std::move(part));
+    }
+
+    std::string closing = "--" + batch_boundary + "--\r\n";
+    content_length += closing.size();
+
+    std::ostringstream header;
+    header << "HTTP/1.1 200 OK\r\n"
+           << "Content-Type: multipart/mixed; boundary=" << batch_boundary << "\r\n"
+           << "Content-Length: " << content_length << "\r\n\r\n";
+    if (verbose) {
+        std::cout << "Enviando lote de " << parts.size() << " archivos (" << content_length << " bytes)" << std::endl;
+    }
+    if (!send_all(client_sock, header.str())) {
+        return false;
+    }
+
+    for (const auto& part : parts) {
+        if (!send_all(client_sock, part.header)) {
+            return false;
+        }
+        if (part.file) {
+            if (!send_file(client_sock, part.file->fd.value(), part.file->size)) {
+                return false;
+            }
+        } else if (!send_all(client_sock, part.error_body)) {
+            return false;
+        }
+        if (!send_all(client_sock, "\r\n")) {
+            return false;
+        }
+    }
+
+    return send_all(client_sock, closing);
+}
+
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Con HTTP/1.0 no hay codificación chunked: el cuerpo se envía tal cual y termina al cerrar la conexión.
+bool send_chunk(int client_sock, std::string_view data, bool chunked) {
+    if (data.empty()) {
+        return true;
+    }
+    if (!chunked) {
+        return send_all(client_sock, data);
+    }
+    std::ostringstream size;
+    size << std::hex << data.size() << "\r\n";
+    return send_all(client_sock, size.str()) && send_all(client_sock, data) && send_all(client_sock, "\r\n");
+}
+
+std::string html_escape(std::string_view value) {
+    std::string escaped;
+    for (char c : value) {
+        switch (c) {
+            case '&': escaped += "&amp;"; break;
+            case '<': escaped += "&lt;"; break;
+            case '>': escaped += "&gt;"; break;
+            case '"': escaped += "&quot;"; break;
+            default: escaped += c;
+        }
+    }
+    return escaped;
+}
+
+std::string json_escape(std::string_view value) {
+    std::string escaped;
+    for (unsigned char c : value) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c < 0x20) {
+            char code[7];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+std::string url_encode(std::string_view value) {
+    std::string encoded;
+    for (unsigned char c : value) {
+        if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            encoded += c;
+        } else {
+            char code[4];
+            snprintf(code, sizeof(code), "%%%02X", c);
+            encoded += code;
+        }
+    }
+    return encoded;
+}
+
+std::string format_mtime(time_t mtime) {
+    char buffer[32];
+    struct tm tm;
+    gmtime_r(&mtime, &tm);
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M", &tm);
+    return buffer;
+}
+
+void render_entry(std::string& out, int dir_fd, const char* name, unsigned char d_type, bool json, bool first) {
+    struct stat entry_stat;
+    bool has_stat = fstatat(dir_fd, name, &entry_stat, 0) == 0;
+    bool is_dir = has_stat ? S_ISDIR(entry_stat.st_mode) : d_type == DT_DIR;
+
+    if (json) {
+        out += first ? "\n" : ",\n";
+        out += "{\"name\":\"" + json_escape(name) + "\",\"type\":\"" + (is_dir ? "directory" : "file") + "\"";
+        if (has_stat) {
+            out += ",\"size\":" + std::to_string(entry_stat.st_size) + ",\"mtime\":" + std::to_string(entry_stat.st_mtime);
+        }
+        out += "}";
+    } else {
+        std::string display = html_escape(name) + (is_dir ? "/" : "");
+        out += "<tr><td><a href=\"" + url_encode(name) + (is_dir ? "/" : "") + "\">" + display + "</a></td><td>";
+        out += has_stat && !is_dir ? std::to_string(entry_stat.st_size) : "-";
+        out += "</td><td>" + (has_stat ? format_mtime(entry_stat.st_mtime) : std::string("-")) + "</td></tr>\n";
+    }
+}
+
+// Un archivo de caché por directorio y formato; su mtime se iguala al del directorio, de modo que la
+// entrada solo vale mientras no se añadan, borren o renombren entradas. Reescribir un archivo en su
+// sitio no cambia el mtime del directorio, así que su tamaño y fecha en el listado pueden quedar
+// desfasados hasta que el directorio cambie: comprobarlo exigiría un stat por entrada, que es justo lo
+// que la caché evita.
+std::string listing_cache_path(const std::string& dir_path, bool json) {
+    std::ostringstream name;
+    name << listing_cache_dir << "/" << std::hex << std::hash<std::string>{}(dir_path) << (json ? ".json" : ".html");
+    return name.str();
+}
+
+bool same_mtime(const struct stat& a, const struct stat& b) {
+    return a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+std::optional<bool> send_cached_listing(int client_sock, const std::string& cache_path, const struct stat& dir_stat, bool json) {
+    struct stat cache_stat;
+    if (stat(cache_path.c_str(), &cache_stat) == -1 || !same_mtime(cache_stat, dir_stat)) {
+        return std::nullopt;
+    }
+
+    auto file = open_file(cache_path);
+    if (!file) {
+        return std::nullopt;
+    }
+
+    std::ostringstream header;
+    header << "HTTP/1.1 200 OK\r\nContent-Type: " << (json ? "application/json" : "text/html; charset=utf-8")
+           << "\r\nContent-Length: " << file->size << "\r\n\r\n";
+    if (verbose) {
+        std::cout << "Listado servido desde la caché: " << cache_path << std::endl;
+    }
+    return send_all(client_sock, header.str()) && send_file(client_sock, file->fd.value(), file->size);
+}
+
+// Genera el listado leyendo el directorio con getdents64 y lo envía por trozos (chunked) a medida que
+// se lee, así un directorio enorme no se construye entero en memoria. La misma salida se guarda en la
+// caché si el directorio no cambió mientras se recorría.
+bool send_directory_listing(int client_sock, const std::string& url_path, const std::string& dir_path, bool json, bool chunked) {
+    SafeFD dir_fd(open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    struct stat dir_stat;
+    if (!dir_fd.is_valid() || fstat(dir_fd.value(), &dir_stat) == -1) {
+        send_response(client_sock, errno == EACCES ? "HTTP/1.1 403 Forbidden" : "HTTP/1.1 404 Not Found",
+                      errno == EACCES ? "Acceso denegado." : "Archivo no encontrado.");
+        return false;
+    }
+
+    std::string cache_path;
+    SafeFD cache_fd;
+    std::string cache_tmp;
+    if (!listing_cache_dir.empty()) {
+        cache_path = listing_cache_path(dir_path, json);
+        if (auto cached = send_cached_listing(client_sock, cache_path, dir_stat, json)) {
+            return cached.value();
+        }
+        cache_tmp = cache_path + ".XXXXXX";
+        cache_fd = SafeFD(mkstemp(cache_tmp.data()));
+    }
+
+    std::string out;
+    auto flush = [&]() {
+        if (cache_fd.is_valid() && !out.empty() && write(cache_fd.value(), out.data(), out.size()) != static_cast<ssize_t>(out.size())) {
+            unlink(cache_tmp.c_str());
+            cache_fd = SafeFD();
+        }
+        bool sent = send_chunk(client_sock, out, chunked);
+        out.clear();
+        return sent;
+    };
+
+    std::string header = std::string("HTTP/1.1 200 OK\r\nContent-Type: ")
+        + (json ? "application/json" : "text/html; charset=utf-8")
+        + (chunked ? "\r\nTransfer-Encoding: chunked\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+    if (!send_all(client_sock, header)) {
+        return false;
+    }
+
+    if (json) {
+        out += "{\"path\":\"" + json_escape(url_path) + "\",\"entries\":[";
+    } else {
+        std::string title = html_escape(url_path);
+        out += "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>Índice de " + title + "</title></head><body>\n";
+        out += "<h1>Índice de " + title + "</h1>\n<table>\n<tr><th>Nombre</th><th>Tamaño</th><th>Modificado (UTC)</th></tr>\n";
+        if (url_path != "/") {
+            out += "<tr><td><a href=\"../\">../</a></td><td>-</td><td>-</td></tr>\n";
+        }
+    }
+
+    alignas(linux_dirent64) char buffer[64 * 1024];
+    bool first = true;
+    long nread;
+    while ((nread = syscall(SYS_getdents64, dir_fd.value(), buffer, sizeof(buffer))) > 0) {
+        for (long pos = 0; pos < nread;) {
+            auto* entry = reinterpret_cast<linux_dirent64*>(buffer + pos);
+            pos += entry->d_reclen;
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            render_entry(out, dir_fd.value(), entry->d_name, entry->d_type, json, first);
+            first = false;
+        }
+        if (!flush()) {
+            unlink(cache_tmp.c_str());
+            return false;
+        }
+    }
+
+    out += json ? "\n]}\n" : "</table>\n</body></html>\n";
+    bool sent = flush() && (!chunked || send_all(client_sock, "0\r\n\r\n"));
+
+    if (cache_fd.is_valid()) {
+        struct stat after_stat;
+        if (nread == 0 && fstat(dir_fd.value(), &after_stat) == 0 && same_mtime(after_stat, dir_stat)) {
+            struct timespec times[2] = {dir_stat.st_atim, dir_stat.st_mtim};
+            futimens(cache_fd.value(), times);
+            rename(cache_tmp.c_str(), cache_path.c_str());
+        } else {
+            unlink(cache_tmp.c_str());
+        }
+    }
+    return sent;
+}
+
+// Un directorio se sirve por su index.html si existe; si no, con el listado de sus entradas. raw_path es
+// la ruta tal como llegó (sin decodificar) y se usa para la redirección.
+bool send_directory(int client_sock, std::string_view raw_path, std::string_view query, const std::string& url_path,
+                    const std::string& dir_path, bool chunked) {
+    if (!url_path.ends_with('/')) {
+        std::string location = std::string(raw_path) + "/" + (query.empty() ? "" : "?" + std::string(query));
+        send_response(client_sock, "HTTP/1.1 301 Moved Permanently\r\nLocation: " + location, "");
+        return true;
+    }
+
+    auto index = open_file(dir_path + "/index.html");
+    if (index) {
+        std::ostringstream header;
+        header << "HTTP/1.1 200 OK\r\nContent-Type: text/html; charset=utf-8\r\nContent-Length: " << index->size << "\r\n\r\n";
+        return send_all(client_sock, header.str()) && send_file(client_sock, index->fd.value(), index->size);
+    }
+
+    bool json = query_param(query, "format") == "json";
+    return send_directory_listing(client_sock, url_path, dir_path, json, chunked);
+}
+
+std::expected<void, int> prepare_listing_cache() {
+    if (mkdir(listing_cache_dir.c_str(), 0700) == -1 && errno != EEXIST) {
+        return std::unexpected(errno);
+    }
+
+    struct stat cache_stat;
+    if (lstat(listing_cache_dir.c_str(), &cache_stat) == -1) {
+        return std::unexpected(errno);
+    }
+    if (!S_ISDIR(cache_stat.st_mode) || cache_stat.st_uid != getuid()) {
+        return std::unexpected(EPERM);
+    }
+    return {};
+}
+
+// Progreso de la precarga en memoria compartida: lo escribe el proceso de precarga y lo lee quien
+// imprime las estadísticas.
+struct warmup_progress {
+    std::atomic<unsigned long> files_total{0};
+    std::atomic<unsigned long> files_done{0};
+    std::atomic<unsigned long> files_skipped{0};
+    std::atomic<unsigned long> bytes_done{0};
+    std::atomic<bool> finished{false};
+};
+
+warmup_progress* warmup = nullptr;
+pid_t warmup_pid = -1;
+
+void log_access(std::string_view method, std::string_view path) {
+    if (access_log_fd == -1) {
+        return;
+    }
+    std::string line = std::to_string(time(nullptr)) + " " + std::string(method) + " " + std::string(path) + "\n";
+    write(access_log_fd, line.data(), line.size());
+}
+
+// Acepta tanto un manifiesto (una ruta por línea) como el registro de accesos: de cada línea se toma
+// la primera palabra que empieza por '/', ya decodificada y con las mismas reglas que una petición
+// (nada fuera de base_path). Las rutas se ordenan por número de apariciones.
+std::vector<std::string> rank_warmup_paths(const std::string& source) {
+    std::ifstream input(source);
+    std::unordered_map<std::string, size_t> hits;
+    std::vector<std::string> order;
+
+    auto count = [&](const std::string& path) {
+        if (path.starts_with("/cgi-bin/") || path.find('\0') != std::string::npos || has_dot_dot_segment(path)) {
+            return;
+        }
+        if (hits[path]++ == 0) {
+            order.push_back(path);
+        }
+    };
+
+    std::string line;
+    while (std::getline(input, line)) {
+        std::istringstream iss(line);
+        std::string word;
+        while (iss >> word && word[0] != '/') {
+        }
+        if (word.empty() || word[0] != '/') {
+            continue;
+        }
+
+        if (word == "/__batch" || word.starts_with("/__batch?")) {
+            for (const auto& path : parse_batch_paths(word, {})) {
+                count(path);
+            }
+        } else {
+            count(url_decode(word.substr(0, word.find('?')), false));
+        }
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&](const std::string& a, const std::string& b) {
+        return hits[a] > hits[b];
+    });
+    return order;
+}
+
+void preload_files(const std::vector<std::string>& paths, size_t budget) {
+    size_t used = 0;
+    for (const auto& path : paths) {
+        if (has_dot_dot_segment(path)) {
+            ++warmup->files_skipped;
+            continue;
+        }
+        auto file = open_file(base_path + path);
+        if (!file || file->size == 0 || used + file->size > budget) {
+            ++warmup->files_skipped;
+            continue;
+        }
+
+        posix_fadvise(file->fd.value(), 0, file->size, POSIX_FADV_WILLNEED);
+        void* mapped_memory = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, file->fd.value(), 0);
+        if (mapped_memory == MAP_FAILED) {
+            ++warmup->files_skipped;
+            continue;
+        }
+        munmap(mapped_memory, file->size);
+
+        used += file->size;
+        ++warmup->files_done;
+        warmup->bytes_done += file->size;
+    }
+}
+
+// La precarga corre en un proceso aparte con prioridad baja, así que el servidor acepta conexiones
+// desde el primer momento. El hijo cierra los sockets de escucha para no mantenerlos vivos si el
+// servidor muere sin pararlo.
+std::expected<void, int> start_warmup(const std::vector<int>& listen_fds) {
+    void* shared = mmap(NULL, sizeof(warmup_progress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        return std::unexpected(errno);
+    }
+    warmup = new (shared) warmup_progress;
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        return std::unexpected(errno);
+    }
+
+    if (pid == 0) {
+        for (int fd : listen_fds) {
+            close(fd);
+        }
+        sigprocmask(SIG_SETMASK, &original_mask, nullptr);
+        signal(SIGTERM, SIG_DFL);
+        nice(10);
+
+        auto paths = rank_warmup_paths(warmup_source);
+        warmup->files_total = paths.size();
+        preload_files(paths, warmup_budget);
+        warmup->finished = true;
+
+        if (verbose) {
+            std::cout << "Precarga completada: " << warmup->files_done << " archivos, "
+                      << warmup->bytes_done / 1024 << " KiB" << std::endl;
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    warmup_pid = pid;
+    return {};
+}
+
+void print_warmup_progress() {
+    if (!warmup) {
+        return;
+    }
+    std::cout << "Precarga" << (warmup->finished ? " completada" : " en curso") << ": "
+              << warmup->files_done << "/" << warmup->files_total << " archivos, "
+              << warmup->files_skipped << " omitidos, " << warmup->bytes_done / 1024 << " de "
+              << warmup_budget / 1024 << " KiB" << std::endl;
+}
+
+void stop_warmup() {
+    if (warmup_pid > 0) {
+        kill(warmup_pid, SIGTERM);
+        waitpid(warmup_pid, nullptr, 0);
+        warmup_pid = -1;
+    }
+}
+
 struct execute_program_error {
     int exit_code;
     int error_code;
@@ -92,6 +753,7 @@ std::expected<std::string, execute_program_error> execute_program(const std::str
 
     if (pid == 0) {
         close(pipefd[0]);
+        signal(SIGPIPE, SIG_DFL);
 
         if (dup2(pipefd[1], STDOUT_FILENO) == -1) {
             close(pipefd[1]);
@@ -143,10 +805,21 @@ std::expected<void, int> parse_args(int argc, char* argv[]) {
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
         if (arg == "-h" || arg == "--help") {
-            std::cout << "Uso: ./docserver [-v | --verbose] [-p <puerto>] [-b <ruta> | --base <ruta>] \n";
+            std::cout << "Uso: ./docserver [-v | --verbose] [-p <puerto>] [-l <dirección> | --listen <dirección>]... [-b <ruta> | --base <ruta>] \n";
             std::cout << "  -v, --verbose  Muestra información detallada de las operaciones." << std::endl;
             std::cout << "  -h, --help     Muestra este mensaje de ayuda." << std::endl;
             std::cout << "  -p, --port     Especifica el puerto en el que escuchar (por defecto 8080)." << std::endl;
+            std::cout << "  -l, --listen   Añade una dirección de escucha: <puerto>, <ipv4>:<puerto>, [<ipv6>]:<puerto>" << std::endl;
+            std::cout << "                 ([::] acepta también IPv4) o unix:<ruta>. Se puede repetir." << std::endl;
+            std::cout << "  -w, --workers  Número de procesos que aceptan conexiones en paralelo (por defecto 1)." << std::endl;
+            std::cout << "      --pin-cpus Fija cada worker a una CPU y reparte las conexiones por la CPU que las recibe." << std::endl;
+            std::cout << "      --access-log <ruta>      Añade una línea por petición al registro de accesos." << std::endl;
+            std::cout << "      --warmup <ruta>          Precarga al arrancar las rutas más pedidas de un manifiesto o registro de accesos." << std::endl;
+            std::cout << "      --warmup-budget <MiB>    Memoria máxima que puede ocupar la precarga (por defecto 256)." << std::endl;
+            std::cout << "      --listing-cache <ruta>   Directorio donde guardar los listados de directorios generados" << std::endl;
+            std::cout << "                               (por defecto /tmp/docserver-listings-<uid>). Solo se invalidan al" << std::endl;
+            std::cout << "                               cambiar las entradas del directorio; el tamaño y la fecha de un" << std::endl;
+            std::cout << "                               archivo reescrito en su sitio pueden aparecer desfasados." << std::endl;
             std::cout << "  -b, --base     Directorio base donde buscar los archivos." << std::endl;
             return {};
         } else if (arg == "-v" || arg == "--verbose") {
@@ -157,6 +830,51 @@ std::expected<void, int> parse_args(int argc, char* argv[]) {
             } else {
                 return std::unexpected(EINVAL);
             }
+        } else if (arg == "-l" || arg == "--listen") {
+            if (i + 1 < argc) {
+                listen_specs.push_back(argv[++i]);
+            } else {
+                return std::unexpected(EINVAL);
+            }
+        } else if (arg == "-w" || arg == "--workers") {
+            if (i + 1 < argc) {
+                int value = std::stoi(argv[++i]);
+                if (value < 1) {
+                    return std::unexpected(EINVAL);
+                }
+                workers = value;
+            } else {
+                return std::unexpected(EINVAL);
+            }
+        } else if (arg == "--pin-cpus") {
+            pin_cpus = true;
+        } else if (arg == "--access-log") {
+            if (i + 1 < argc) {
+                access_log_fd = open(argv[++i], O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+                if (access_log_fd == -1) {
+                    return std::unexpected(errno);
+                }
+            } else {
+                return std::unexpected(EINVAL);
+            }
+        } else if (arg == "--warmup") {
+            if (i + 1 < argc) {
+                warmup_source = argv[++i];
+            } else {
+                return std::unexpected(EINVAL);
+            }
+        } else if (arg == "--warmup-budget") {
+            if (i + 1 < argc) {
+                warmup_budget = std::stoul(argv[++i]) * 1024 * 1024;
+            } else {
+                return std::unexpected(EINVAL);
+            }
+        } else if (arg == "--listing-cache") {
+            if (i + 1 < argc) {
+                listing_cache_dir = argv[++i];
+            } else {
+                return std::unexpected(EINVAL);
+            }
         } else if (arg == "-b" || arg == "--base") {
             if (i + 1 < argc) {
                 base_path = argv[++i];
@@ -166,6 +884,10 @@ std::expected<void, int> parse_args(int argc, char* argv[]) {
         }
     }
 
+    if (listing_cache_dir.empty()) {
+        listing_cache_dir = "/tmp/docserver-listings-" + std::to_string(getuid());
+    }
+
     if (base_path.empty()) {
         const char* env_base = std::getenv("DOCSERVER_BASEDIR");
         if (env_base) {
@@ -183,154 +905,910 @@ std::expected<void, int> parse_args(int argc, char* argv[]) {
     return {};
 }
 
-std::expected<int, int> make_socket(uint16_t port) {
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd == -1) {
-        return std::unexpected(errno);
+void handle_signal(int signum) {
+    if (signum == SIGUSR2) {
+        upgrade_requested = 1;
+    } else if (signum == SIGUSR1) {
+        stats_requested = 1;
+    } else if (signum == SIGTERM) {
+        shutdown_requested = 1;
     }
+}
 
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(port);
+// El bucle principal mantiene las señales bloqueadas y solo las recibe dentro de ppoll; los hijos
+// heredan el manejador con SA_RESTART, así que una señal no corta la petición que están atendiendo.
+std::expected<void, int> install_signal_handlers() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
 
-    if (bind(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
-        close(sockfd);
-        return std::unexpected(errno);
+    sigset_t blocked;
+    sigemptyset(&blocked);
+    for (int signum : {SIGTERM, SIGUSR1, SIGUSR2, SIGCHLD}) {
+        if (sigaction(signum, &action, nullptr) == -1) {
+            return std::unexpected(errno);
+        }
+        sigaddset(&blocked, signum);
     }
 
-    return sockfd;
-}
-
-std::expected<int, int> accept_connection(const int& socket, sockaddr_in& client_addr) {
-    socklen_t addr_len = sizeof(client_addr);
-    int client_sock = accept(socket, (struct sockaddr*)&client_addr, &addr_len);
-    if (client_sock == -1) {
+    if (sigprocmask(SIG_BLOCK, &blocked, &original_mask) == -1) {
         return std::unexpected(errno);
     }
-    return client_sock;
+    return {};
 }
 
-std::expected<void, int> listen_connection(const int& socket) {
-    if (listen(socket, 5) == -1) {
-        return std::unexpected(errno);
+std::string executable_path(const char* argv0) {
+    char buffer[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", buffer, sizeof(buffer) - 1);
+    if (length == -1) {
+        return argv0;
     }
-    return {};
+    buffer[length] = '\0';
+    return buffer;
 }
 
-std::expected<std::string, int> receive_request(const SafeFD& socket, size_t max_size) {
-    std::string request(max_size, 0);
-    ssize_t bytes_received = recv(socket.value(), &request[0], max_size, 0);
-    if (bytes_received == -1) {
+struct listen_address {
+    sockaddr_storage addr;
+    socklen_t length;
+};
+
+// Con varios workers cada socket TCP se abre una vez por worker con SO_REUSEPORT; los de Unix se
+// comparten. El worker w acepta por fds[w % fds.size()].
+struct listener {
+    std::vector<int> fds;
+    std::string name;
+    unsigned long accepted = 0;
+    unsigned long failed = 0;
+    unsigned long accept_errors = 0;
+};
+
+std::expected<listen_address, int> parse_listen_address(const std::string& spec) {
+    listen_address result;
+    memset(&result.addr, 0, sizeof(result.addr));
+
+    if (spec.starts_with("unix:")) {
+        std::string path = spec.substr(5);
+        auto* unix_addr = reinterpret_cast<sockaddr_un*>(&result.addr);
+        if (path.empty() || path.size() >= sizeof(unix_addr->sun_path)) {
+            return std::unexpected(EINVAL);
+        }
+        unix_addr->sun_family = AF_UNIX;
+        memcpy(unix_addr->sun_path, path.c_str(), path.size() + 1);
+        result.length = offsetof(sockaddr_un, sun_path) + path.size() + 1;
+        return result;
+    }
+
+    std::string host = "0.0.0.0";
+    std::string port_str = spec;
+    if (spec.starts_with("[")) {
+        auto bracket = spec.find("]:");
+        if (bracket == std::string::npos) {
+            return std::unexpected(EINVAL);
+        }
+        host = spec.substr(1, bracket - 1);
+        port_str = spec.substr(bracket + 2);
+    } else if (auto colon = spec.rfind(':'); colon != std::string::npos) {
+        host = spec.substr(0, colon);
+        port_str = spec.substr(colon + 1);
+    }
+
+    char* end;
+    long listen_port = std::strtol(port_str.c_str(), &end, 10);
+    if (port_str.empty() || *end != '\0' || listen_port < 0 || listen_port > 65535) {
+        return std::unexpected(EINVAL);
+    }
+
+    if (host.find(':') != std::string::npos) {
+        auto* addr6 = reinterpret_cast<sockaddr_in6*>(&result.addr);
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = htons(listen_port);
+        if (inet_pton(AF_INET6, host.c_str(), &addr6->sin6_addr) != 1) {
+            return std::unexpected(EINVAL);
+        }
+        result.length = sizeof(sockaddr_in6);
+    } else {
+        auto* addr4 = reinterpret_cast<sockaddr_in*>(&result.addr);
+        addr4->sin_family = AF_INET;
+        addr4->sin_port = htons(listen_port);
+        if (inet_pton(AF_INET, host.c_str(), &addr4->sin_addr) != 1) {
+            return std::unexpected(EINVAL);
+        }
+        result.length = sizeof(sockaddr_in);
+    }
+    return result;
+}
+
+std::string format_address(const sockaddr_storage& addr) {
+    char host[INET6_ADDRSTRLEN] = {};
+    if (addr.ss_family == AF_UNIX) {
+        return std::string("unix:") + reinterpret_cast<const sockaddr_un&>(addr).sun_path;
+    } else if (addr.ss_family == AF_INET6) {
+        const auto& addr6 = reinterpret_cast<const sockaddr_in6&>(addr);
+        inet_ntop(AF_INET6, &addr6.sin6_addr, host, sizeof(host));
+        return "[" + std::string(host) + "]:" + std::to_string(ntohs(addr6.sin6_port));
+    } else {
+        const auto& addr4 = reinterpret_cast<const sockaddr_in&>(addr);
+        inet_ntop(AF_INET, &addr4.sin_addr, host, sizeof(host));
+        return std::string(host) + ":" + std::to_string(ntohs(addr4.sin_port));
+    }
+}
+
+std::string socket_name(int sockfd) {
+    sockaddr_storage addr;
+    memset(&addr, 0, sizeof(addr));
+    socklen_t length = sizeof(addr);
+    if (getsockname(sockfd, reinterpret_cast<sockaddr*>(&addr), &length) == -1) {
+        return "fd " + std::to_string(sockfd);
+    }
+    return format_address(addr);
+}
+
+std::expected<std::vector<std::vector<int>>, int> inherited_sockets() {
+    const char* env_fds = std::getenv(listen_fds_env);
+    if (!env_fds) {
+        return std::unexpected(ENOENT);
+    }
+
+    std::string value = env_fds;
+    unsetenv(listen_fds_env);
+
+    std::vector<std::vector<int>> groups;
+    std::istringstream groups_stream(value);
+    std::string group;
+    while (std::getline(groups_stream, group, ';')) {
+        std::vector<int> fds;
+        std::istringstream iss(group);
+        std::string item;
+        while (std::getline(iss, item, ',')) {
+            char* end;
+            long fd = std::strtol(item.c_str(), &end, 10);
+            if (item.empty() || *end != '\0' || fd < 0 || fd > INT_MAX) {
+                return std::unexpected(EBADF);
+            }
+
+            int accepting = 0;
+            socklen_t length = sizeof(accepting);
+            if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &accepting, &length) == -1) {
+                return std::unexpected(errno);
+            }
+            if (!accepting) {
+                return std::unexpected(EINVAL);
+            }
+
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            fds.push_back(fd);
+        }
+
+        if (fds.empty()) {
+            return std::unexpected(EBADF);
+        }
+        groups.push_back(std::move(fds));
+    }
+
+    if (groups.empty()) {
+        return std::unexpected(EBADF);
+    }
+    return groups;
+}
+
+// Arranca el nuevo binario heredando los sockets de escucha. Si execv falla, el hijo escribe el errno
+// en el pipe; si no, el nuevo proceso escribe un byte cuando ya tiene sus sockets listos. Solo entonces
+// deja de aceptar el proceso actual: un cierre sin datos o el plazo agotado cuentan como fallo.
+std::expected<pid_t, int> spawn_upgrade(const std::vector<listener>& listeners, const std::string& program, char* argv[]) {
+    int status_pipe[2];
+    if (pipe2(status_pipe, O_CLOEXEC) == -1) {
         return std::unexpected(errno);
     }
-    request.resize(bytes_received);
-    return request;
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        int error = errno;
+        close(status_pipe[0]);
+        close(status_pipe[1]);
+        return std::unexpected(error);
+    }
+
+    if (pid == 0) {
+        close(status_pipe[0]);
+        fcntl(status_pipe[1], F_SETFD, 0);
+        setenv(ready_fd_env, std::to_string(status_pipe[1]).c_str(), 1);
+
+        std::string fds;
+        for (const auto& l : listeners) {
+            fds += fds.empty() ? "" : ";";
+            for (size_t i = 0; i < l.fds.size(); ++i) {
+                fcntl(l.fds[i], F_SETFD, 0);
+                fds += (i == 0 ? "" : ",") + std::to_string(l.fds[i]);
+            }
+        }
+        setenv(listen_fds_env, fds.c_str(), 1);
+        sigprocmask(SIG_SETMASK, &original_mask, nullptr);
+
+        execv(program.c_str(), argv);
+
+        int error = errno;
+        write(status_pipe[1], &error, sizeof(error));
+        _exit(EXIT_FAILURE);
+    }
+
+    close(status_pipe[1]);
+    pollfd ready = {status_pipe[0], POLLIN, 0};
+    int polled;
+    while ((polled = poll(&ready, 1, upgrade_timeout_seconds * 1000)) == -1 && errno == EINTR) {
+    }
+
+    int error = ETIMEDOUT;
+    ssize_t nbytes = 0;
+    if (polled > 0) {
+        while ((nbytes = read(status_pipe[0], &error, sizeof(error))) == -1 && errno == EINTR) {
+        }
+    }
+    close(status_pipe[0]);
+
+    if (nbytes == 1) {
+        return pid;
+    }
+    if (nbytes != sizeof(error)) {
+        error = polled > 0 ? ECHILD : ETIMEDOUT;
+        kill(pid, SIGKILL);
+    }
+    waitpid(pid, nullptr, 0);
+    return std::unexpected(error);
 }
 
-int main(int argc, char* argv[]) {
-    auto args_result = parse_args(argc, argv);
-    if (!args_result) {
-        std::cerr << "Error al analizar argumentos: " << strerror(args_result.error()) << std::endl;
-        return args_result.error();
+void notify_upgrade_ready() {
+    const char* env_fd = std::getenv(ready_fd_env);
+    if (!env_fd) {
+        return;
+    }
+    int fd = std::atoi(env_fd);
+    unsetenv(ready_fd_env);
+
+    char ready = 1;
+    write(fd, &ready, sizeof(ready));
+    close(fd);
+}
+
+int wait_process(pid_t pid) {
+    int status = 0;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            return -1;
+        }
     }
+    return status;
+}
 
-    auto sockfd = make_socket(port);
-    if (!sockfd) {
-        std::cerr << "Error al crear el socket: " << strerror(sockfd.error()) << std::endl;
-        return sockfd.error();
+// Espera a que termine el proceso; pasado el plazo lo mata para que un drenado no se alargue sin límite.
+int wait_process_until(pid_t pid, time_t deadline) {
+    int status = 0;
+    while (time(nullptr) < deadline) {
+        pid_t result = waitpid(pid, &status, WNOHANG);
+        if (result == pid || (result == -1 && errno != EINTR)) {
+            return result == pid ? status : -1;
+        }
+        usleep(100 * 1000);
     }
+    kill(pid, SIGKILL);
+    return wait_process(pid);
+}
 
-    auto listen_result = listen_connection(sockfd.value());
-    if (!listen_result) {
-        std::cerr << "Error al poner el socket a la escucha: " << strerror(listen_result.error()) << std::endl;
-        close(sockfd.value());
-        return listen_result.error();
+std::expected<int, int> make_socket(const listen_address& address, bool reuse_port) {
+    int sockfd = socket(address.addr.ss_family, SOCK_STREAM, 0);
+    if (sockfd == -1) {
+        return std::unexpected(errno);
     }
 
-    std::cout << "Escuchando en el puerto " << port << "..." << std::endl;
+    if (address.addr.ss_family == AF_UNIX) {
+        // Solo se borra un socket abandonado: si otro servidor sigue escuchando en la ruta, bind fallará.
+        const char* path = reinterpret_cast<const sockaddr_un&>(address.addr).sun_path;
+        struct stat path_stat;
+        if (stat(path, &path_stat) == 0 && S_ISSOCK(path_stat.st_mode)) {
+            SafeFD probe(socket(AF_UNIX, SOCK_STREAM, 0));
+            if (probe.is_valid() && connect(probe.value(), reinterpret_cast<const sockaddr*>(&address.addr), address.length) == -1
+                && errno == ECONNREFUSED) {
+                unlink(path);
+            }
+        }
+    } else {
+        int reuse = 1;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1) {
+            close(sockfd);
+            return std::unexpected(errno);
+        }
+        if (reuse_port && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == -1) {
+            close(sockfd);
+            return std::unexpected(errno);
+        }
+    }
 
-    while (true) {
-        sockaddr_in client_addr;
-        auto client_sock = accept_connection(sockfd.value(), client_addr);
-        if (!client_sock) {
-            std::cerr << "Error al aceptar la conexión: " << strerror(client_sock.error()) << std::endl;
-            close(sockfd.value());
-            return client_sock.error();
+    if (address.addr.ss_family == AF_INET6) {
+        const auto& addr6 = reinterpret_cast<const sockaddr_in6&>(address.addr);
+        int v6only = IN6_IS_ADDR_UNSPECIFIED(&addr6.sin6_addr) ? 0 : 1;
+        if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) == -1) {
+            close(sockfd);
+            return std::unexpected(errno);
         }
+    }
 
-        pid_t pid = fork();
-        if (pid == 0) {
-            close(sockfd.value());
+    if (bind(sockfd, reinterpret_cast<const sockaddr*>(&address.addr), address.length) == -1) {
+        close(sockfd);
+        return std::unexpected(errno);
+    }
 
-            std::string request;
-            auto request_result = receive_request(client_sock.value(), 1024);
-            if (!request_result) {
-                std::cerr << "Error al recibir la solicitud: " << strerror(request_result.error()) << std::endl;
-                send_response(client_sock.value(), "HTTP/1.1 400 Bad Request", "Error al recibir la solicitud.");
-                close(client_sock.value());
-                return EXIT_FAILURE;
+    return sockfd;
+}
+
+std::expected<int, int> accept_connection(const int& socket, sockaddr_storage& client_addr) {
+    socklen_t addr_len = sizeof(client_addr);
+    int client_sock = accept(socket, (struct sockaddr*)&client_addr, &addr_len);
+    if (client_sock == -1) {
+        return std::unexpected(errno);
+    }
+    return client_sock;
+}
+
+std::expected<void, int> listen_connection(const int& socket) {
+    if (listen(socket, 5) == -1) {
+        return std::unexpected(errno);
+    }
+    return {};
+}
+
+std::vector<int> allowed_cpu_list() {
+    std::vector<int> cpus;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        return cpus;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// Programa CBPF del grupo SO_REUSEPORT: una tabla que lleva la CPU que recibe el paquete al índice del
+// worker fijado a ella (el mismo reparto que pin_to_cpu). Para una CPU sin worker devuelve un índice
+// fuera del grupo y el kernel vuelve a repartir por hash.
+std::expected<void, int> attach_cpu_steering(int sockfd, const std::vector<int>& cpus, size_t group_size) {
+    std::vector<sock_filter> code;
+    code.push_back({BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<__u32>(SKF_AD_OFF + SKF_AD_CPU)});
+    for (size_t w = 0; w < group_size && w < cpus.size(); ++w) {
+        code.push_back({BPF_JMP | BPF_JEQ | BPF_K, 0, 1, static_cast<__u32>(cpus[w])});
+        code.push_back({BPF_RET | BPF_K, 0, 0, static_cast<__u32>(w)});
+    }
+    code.push_back({BPF_RET | BPF_K, 0, 0, 0xffffffff});
+
+    if (code.size() > BPF_MAXINSNS) {
+        return std::unexpected(E2BIG);
+    }
+    sock_fprog program = {static_cast<unsigned short>(code.size()), code.data()};
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == -1) {
+        return std::unexpected(errno);
+    }
+    return {};
+}
+
+std::expected<int, int> pin_to_cpu(size_t worker) {
+    auto cpus = allowed_cpu_list();
+    if (cpus.empty()) {
+        return std::unexpected(EINVAL);
+    }
+
+    int cpu = cpus[worker % cpus.size()];
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    if (sched_setaffinity(0, sizeof(mask), &mask) == -1) {
+        return std::unexpected(errno);
+    }
+    return cpu;
+}
+
+void close_listeners(const std::vector<listener>& listeners, bool remove_unix_paths) {
+    for (const auto& l : listeners) {
+        for (int fd : l.fds) {
+            close(fd);
+        }
+        // Sin fds el bind no llegó a hacerse: la ruta puede ser el socket de otro servidor.
+        if (remove_unix_paths && !l.fds.empty() && l.name.starts_with("unix:")) {
+            unlink(l.name.substr(5).c_str());
+        }
+    }
+}
+
+// Los sockets heredados en una actualización se reutilizan tal cual; si no hay, se crea uno por cada
+// -l (o uno en el puerto de -p si no se indicó ninguno).
+std::expected<std::vector<listener>, int> make_listeners() {
+    std::vector<listener> listeners;
+
+    auto inherited = inherited_sockets();
+    if (inherited) {
+        for (auto& fds : inherited.value()) {
+            std::string name = socket_name(fds.front());
+            listeners.push_back({std::move(fds), name});
+        }
+    } else if (inherited.error() != ENOENT) {
+        std::cerr << "Error al recuperar los sockets heredados: " << strerror(inherited.error()) << std::endl;
+        return std::unexpected(inherited.error());
+    } else {
+        std::vector<std::string> specs = listen_specs;
+        if (specs.empty()) {
+            specs.push_back(std::to_string(port));
+        }
+
+        for (const auto& spec : specs) {
+            auto address = parse_listen_address(spec);
+            if (!address) {
+                std::cerr << "Dirección de escucha no válida: " << spec << std::endl;
+                close_listeners(listeners, true);
+                return std::unexpected(address.error());
             }
 
-            request = request_result.value();
-            std::istringstream iss(request);
-            std::string method, file_path;
-            iss >> method >> file_path;
+            bool per_worker = workers > 1 && address->addr.ss_family != AF_UNIX;
+            listeners.push_back({{}, format_address(address->addr)});
+            auto& l = listeners.back();
 
-            if (method != "GET" || file_path.empty() || file_path[0] != '/') {
-                send_response(client_sock.value(), "HTTP/1.1 400 Bad Request", "Solicitud no válida.");
-                close(client_sock.value());
-                return EXIT_FAILURE;
+            for (size_t w = 0; w < (per_worker ? workers : 1); ++w) {
+                auto sockfd = make_socket(address.value(), per_worker);
+                if (!sockfd) {
+                    std::cerr << "Error al crear el socket " << spec << ": " << strerror(sockfd.error()) << std::endl;
+                    close_listeners(listeners, true);
+                    return std::unexpected(sockfd.error());
+                }
+                l.fds.push_back(sockfd.value());
+
+                auto listen_result = listen_connection(sockfd.value());
+                if (!listen_result) {
+                    std::cerr << "Error al poner el socket " << spec << " a la escucha: " << strerror(listen_result.error()) << std::endl;
+                    close_listeners(listeners, true);
+                    return std::unexpected(listen_result.error());
+                }
             }
 
-            if (file_path.starts_with("/cgi-bin/")) {
-                auto exec_path = base_path + file_path;
-                auto result = execute_program(exec_path, {exec_path, {}});
-                if (!result) {
-                    if (result.error().exit_code == -1 && result.error().error_code == ENOENT) {
-                        send_response(client_sock.value(), "HTTP/1.1 404 Not Found", "Archivo no encontrado.");
-                    } else if (result.error().exit_code == -1 && result.error().error_code == EACCES) {
-                        send_response(client_sock.value(), "HTTP/1.1 403 Forbidden", "Acceso denegado.");
-                    } else {
-                        std::cerr << "Error en la ejecución del programa: " << strerror(result.error().error_code) << std::endl;
-                        send_response(client_sock.value(), "HTTP/1.1 500 Internal Server Error", "Error interno del servidor.");
-                    }
-                    close(client_sock.value());
-                    return EXIT_FAILURE;
+            auto cpus = allowed_cpu_list();
+            if (per_worker && pin_cpus && workers <= cpus.size()) {
+                auto steering = attach_cpu_steering(l.fds.front(), cpus, l.fds.size());
+                if (!steering) {
+                    std::cerr << "No se pudo repartir " << spec << " por CPU: " << strerror(steering.error()) << std::endl;
                 }
+            }
+        }
+    }
 
-                auto output = result.value();
-                std::ostringstream header;
-                header << "HTTP/1.1 200 OK\r\nContent-Length: " << output.size() << "\r\n\r\n";
-                send_response(client_sock.value(), header.str(), output);
-                close(client_sock.value());
-                return EXIT_SUCCESS;
+    for (const auto& l : listeners) {
+        for (int fd : l.fds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+    }
+    return listeners;
+}
+
+void print_stats(const std::vector<listener>& listeners, const std::string& label) {
+    for (const auto& l : listeners) {
+        std::cout << label << "Estadísticas de " << l.name << ": " << l.accepted << " conexiones aceptadas, "
+                  << l.failed << " fallidas, " << l.accept_errors << " errores al aceptar" << std::endl;
+    }
+}
+
+size_t content_length(std::string_view headers) {
+    std::string lower(headers);
+    for (auto& c : lower) {
+        c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+    auto pos = lower.find("\r\ncontent-length:");
+    if (pos == std::string::npos) {
+        return 0;
+    }
+    return std::strtoul(lower.c_str() + pos + 17, nullptr, 10);
+}
+
+// Sigue leyendo hasta tener las cabeceras completas y, si las hay, los Content-Length bytes del cuerpo.
+// Devuelve EMSGSIZE si la petición no cabe en max_size.
+std::expected<std::string, int> receive_request(int socket, size_t max_size) {
+    std::string request(max_size, 0);
+    size_t received = 0;
+    while (received < max_size) {
+        ssize_t bytes_received = recv(socket, &request[received], max_size - received, 0);
+        if (bytes_received == -1) {
+            if (errno == EINTR) {
+                continue;
             }
+            return std::unexpected(errno);
+        }
+        if (bytes_received == 0) {
+            break;
+        }
+        received += bytes_received;
 
-            file_path = base_path + file_path;
+        auto header_end = std::string_view(request.data(), received).find("\r\n\r\n");
+        if (header_end != std::string_view::npos) {
+            size_t total = header_end + 4 + content_length(std::string_view(request.data(), header_end));
+            if (total > max_size) {
+                return std::unexpected(EMSGSIZE);
+            }
+            if (received >= total) {
+                break;
+            }
+        } else if (received == max_size) {
+            return std::unexpected(EMSGSIZE);
+        }
+    }
+    request.resize(received);
+    return request;
+}
+
+// Tras responder antes de leer todo el cuerpo, se descarta lo que quede para que el close() no envíe
+// un RST que haga perder la respuesta al cliente. La espera la acotan SO_RCVTIMEO y un máximo de bytes.
+void discard_input(int client_sock) {
+    shutdown(client_sock, SHUT_WR);
+    char buffer[4096];
+    size_t discarded = 0;
+    ssize_t nbytes;
+    while (discarded < 16 * max_request_size && (nbytes = recv(client_sock, buffer, sizeof(buffer), 0)) > 0) {
+        discarded += nbytes;
+    }
+}
+
+int handle_connection(int client_sock) {
+    std::string request;
+    auto request_result = receive_request(client_sock, max_request_size);
+    if (!request_result && request_result.error() == EMSGSIZE) {
+        send_response(client_sock, "HTTP/1.1 413 Payload Too Large\r\nConnection: close", "Solicitud demasiado grande.");
+        discard_input(client_sock);
+        close(client_sock);
+        return EXIT_FAILURE;
+    }
+    if (!request_result) {
+        std::cerr << "Error al recibir la solicitud: " << strerror(request_result.error()) << std::endl;
+        send_response(client_sock, "HTTP/1.1 400 Bad Request", "Error al recibir la solicitud.");
+        close(client_sock);
+        return EXIT_FAILURE;
+    }
 
-            auto file_result = read_file(file_path);
-            if (file_result.empty()) {
-                send_response(client_sock.value(), "HTTP/1.1 404 Not Found", "Archivo no encontrado.");
+    request = request_result.value();
+    std::istringstream iss(request);
+    std::string method, file_path, version;
+    iss >> method >> file_path >> version;
+
+    bool is_batch = file_path == "/__batch" || file_path.starts_with("/__batch?");
+    if ((method != "GET" && !(is_batch && method == "POST")) || file_path.empty() || file_path[0] != '/') {
+        send_response(client_sock, "HTTP/1.1 400 Bad Request", "Solicitud no válida.");
+        close(client_sock);
+        return EXIT_FAILURE;
+    }
+
+    if (is_batch) {
+        log_access(method, file_path);
+        std::string_view body;
+        auto body_pos = request.find("\r\n\r\n");
+        if (method == "POST" && body_pos != std::string::npos) {
+            body = std::string_view(request).substr(body_pos + 4, content_length(std::string_view(request).substr(0, body_pos)));
+        }
+
+        auto paths = parse_batch_paths(file_path, body);
+        if (paths.empty() || paths.size() > max_batch_files) {
+            send_response(client_sock, "HTTP/1.1 400 Bad Request", "Lote de archivos no válido.");
+            close(client_sock);
+            return EXIT_FAILURE;
+        }
+
+        bool sent = send_batch(client_sock, paths);
+        close(client_sock);
+        return sent ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (file_path.starts_with("/cgi-bin/")) {
+        log_access(method, file_path);
+        auto exec_path = base_path + file_path;
+        auto result = execute_program(exec_path, {exec_path, {}});
+        if (!result) {
+            if (result.error().exit_code == -1 && result.error().error_code == ENOENT) {
+                send_response(client_sock, "HTTP/1.1 404 Not Found", "Archivo no encontrado.");
+            } else if (result.error().exit_code == -1 && result.error().error_code == EACCES) {
+                send_response(client_sock, "HTTP/1.1 403 Forbidden", "Acceso denegado.");
             } else {
-                std::ostringstream header;
-                header << "HTTP/1.1 200 OK\r\nContent-Length: " << file_result.size() << "\r\n\r\n";
-                send_response(client_sock.value(), header.str(), file_result);
+                std::cerr << "Error en la ejecución del programa: " << strerror(result.error().error_code) << std::endl;
+                send_response(client_sock, "HTTP/1.1 500 Internal Server Error", "Error interno del servidor.");
             }
+            close(client_sock);
+            return EXIT_FAILURE;
+        }
+
+        auto output = result.value();
+        std::ostringstream header;
+        header << "HTTP/1.1 200 OK\r\nContent-Length: " << output.size() << "\r\n\r\n";
+        send_response(client_sock, header.str(), output);
+        close(client_sock);
+        return EXIT_SUCCESS;
+    }
+
+    std::string query;
+    if (auto query_pos = file_path.find('?'); query_pos != std::string::npos) {
+        query = file_path.substr(query_pos + 1);
+        file_path.resize(query_pos);
+    }
+
+    std::string raw_path = file_path;
+    file_path = url_decode(raw_path, false);
+    if (file_path.find('\0') != std::string::npos || has_dot_dot_segment(file_path)) {
+        send_response(client_sock, "HTTP/1.1 403 Forbidden", "Acceso denegado.");
+        close(client_sock);
+        return EXIT_FAILURE;
+    }
+
+    log_access(method, raw_path);
+
+    struct stat path_stat;
+    if (stat((base_path + file_path).c_str(), &path_stat) == 0 && S_ISDIR(path_stat.st_mode)) {
+        bool sent = send_directory(client_sock, raw_path, query, file_path, base_path + file_path, version == "HTTP/1.1");
+        close(client_sock);
+        return sent ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    file_path = base_path + file_path;
+
+    auto file_result = read_file(file_path);
+    if (file_result.empty()) {
+        send_response(client_sock, "HTTP/1.1 404 Not Found", "Archivo no encontrado.");
+    } else {
+        std::ostringstream header;
+        header << "HTTP/1.1 200 OK\r\nContent-Length: " << file_result.size() << "\r\n\r\n";
+        send_response(client_sock, header.str(), file_result);
+    }
+
+    close(client_sock);
+    return EXIT_SUCCESS;
+}
+
+// Bucle de aceptación de un worker. En modo independiente (un solo worker) también atiende SIGUSR2 y es
+// dueño de los sockets; con varios workers de eso se encarga el proceso supervisor.
+int serve(std::vector<listener>& listeners, size_t worker, bool standalone, const std::string& program, char* argv[]) {
+    std::string label = standalone ? "" : "[worker " + std::to_string(worker) + "] ";
 
-            close(client_sock.value());
-            return EXIT_SUCCESS;
-        } else if (pid > 0) {
-            close(client_sock.value());
-            waitpid(pid, nullptr, 0);
+    if (pin_cpus) {
+        auto cpu = pin_to_cpu(worker);
+        if (!cpu) {
+            std::cerr << label << "No se pudo fijar la CPU: " << strerror(cpu.error()) << std::endl;
         } else {
-            std::cerr << "Error en fork: " << strerror(errno) << std::endl;
-            close(client_sock.value());
-            close(sockfd.value());
+            for (const auto& l : listeners) {
+                int incoming_cpu = cpu.value();
+                setsockopt(l.fds[worker % l.fds.size()], SOL_SOCKET, SO_INCOMING_CPU, &incoming_cpu, sizeof(incoming_cpu));
+            }
+            if (verbose) {
+                std::cout << label << "Fijado a la CPU " << cpu.value() << std::endl;
+            }
+        }
+    }
+
+    std::vector<pollfd> poll_fds;
+    for (const auto& l : listeners) {
+        poll_fds.push_back({l.fds[worker % l.fds.size()], POLLIN, 0});
+    }
+
+    bool upgraded = false;
+    while (!shutdown_requested) {
+        if (stats_requested) {
+            stats_requested = 0;
+            print_stats(listeners, label);
+            if (standalone) {
+                print_warmup_progress();
+            }
+        }
+
+        if (upgrade_requested) {
+            upgrade_requested = 0;
+            if (!standalone) {
+                continue;
+            }
+            auto upgrade = spawn_upgrade(listeners, program, argv);
+            if (!upgrade) {
+                std::cerr << "Error al lanzar el nuevo binario: " << strerror(upgrade.error()) << std::endl;
+                continue;
+            }
+            std::cout << "Nuevo proceso " << upgrade.value() << " atendiendo las conexiones" << std::endl;
+            upgraded = true;
+            break;
+        }
+
+        if (standalone && warmup_pid > 0 && waitpid(warmup_pid, nullptr, WNOHANG) == warmup_pid) {
+            warmup_pid = -1;
+        }
+
+        if (ppoll(poll_fds.data(), poll_fds.size(), nullptr, &original_mask) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << label << "Error en poll: " << strerror(errno) << std::endl;
+            close_listeners(listeners, standalone);
             return EXIT_FAILURE;
         }
+
+        for (size_t i = 0; i < poll_fds.size(); ++i) {
+            if (!(poll_fds[i].revents & POLLIN)) {
+                continue;
+            }
+            auto& l = listeners[i];
+
+            sockaddr_storage client_addr;
+            auto client_sock = accept_connection(poll_fds[i].fd, client_addr);
+            if (!client_sock) {
+                if (client_sock.error() != EAGAIN && client_sock.error() != EWOULDBLOCK && client_sock.error() != EINTR) {
+                    std::cerr << label << "Error al aceptar la conexión en " << l.name << ": " << strerror(client_sock.error()) << std::endl;
+                    ++l.accept_errors;
+                }
+                continue;
+            }
+            ++l.accepted;
+
+            timeval timeout = {client_timeout_seconds, 0};
+            setsockopt(client_sock.value(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(client_sock.value(), SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+            pid_t pid = fork();
+            if (pid == 0) {
+                close_listeners(listeners, false);
+                sigprocmask(SIG_SETMASK, &original_mask, nullptr);
+                signal(SIGPIPE, SIG_IGN);
+                return handle_connection(client_sock.value());
+            } else if (pid > 0) {
+                close(client_sock.value());
+                int status = wait_process(pid);
+                if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+                    ++l.failed;
+                }
+            } else {
+                std::cerr << label << "Error en fork: " << strerror(errno) << std::endl;
+                close(client_sock.value());
+                close_listeners(listeners, standalone);
+                return EXIT_FAILURE;
+            }
+        }
     }
 
+    close_listeners(listeners, standalone && !upgraded);
+    print_stats(listeners, label);
+    if (standalone) {
+        stop_warmup();
+        std::cout << "Sin conexiones en curso, terminando." << std::endl;
+    }
     return EXIT_SUCCESS;
 }
+
+std::expected<pid_t, int> spawn_worker(std::vector<listener>& listeners, size_t worker, const std::string& program, char* argv[]) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        return std::unexpected(errno);
+    }
+    if (pid == 0) {
+        exit(serve(listeners, worker, false, program, argv));
+    }
+    return pid;
+}
+
+// Proceso supervisor con varios workers: los relanza si mueren, les reenvía SIGUSR1 y SIGTERM y, en una
+// actualización, les pide que terminen sus conexiones una vez el nuevo binario tiene los sockets.
+int supervise(std::vector<listener>& listeners, const std::string& program, char* argv[]) {
+    std::vector<pid_t> worker_pids(workers, -1);
+    for (size_t w = 0; w < workers; ++w) {
+        auto pid = spawn_worker(listeners, w, program, argv);
+        if (!pid) {
+            std::cerr << "Error al crear el worker " << w << ": " << strerror(pid.error()) << std::endl;
+            shutdown_requested = 1;
+            break;
+        }
+        worker_pids[w] = pid.value();
+    }
+
+    bool upgraded = false;
+    while (!shutdown_requested) {
+        sigsuspend(&original_mask);
+
+        if (stats_requested) {
+            stats_requested = 0;
+            print_warmup_progress();
+            for (pid_t pid : worker_pids) {
+                kill(pid, SIGUSR1);
+            }
+        }
+
+        if (upgrade_requested) {
+            upgrade_requested = 0;
+            auto upgrade = spawn_upgrade(listeners, program, argv);
+            if (!upgrade) {
+                std::cerr << "Error al lanzar el nuevo binario: " << strerror(upgrade.error()) << std::endl;
+            } else {
+                std::cout << "Nuevo proceso " << upgrade.value() << " atendiendo las conexiones" << std::endl;
+                upgraded = true;
+                break;
+            }
+        }
+
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            if (pid == warmup_pid) {
+                warmup_pid = -1;
+            }
+            for (size_t w = 0; w < workers; ++w) {
+                if (worker_pids[w] != pid || shutdown_requested) {
+                    continue;
+                }
+                std::cerr << "El worker " << w << " terminó inesperadamente, relanzándolo" << std::endl;
+                auto respawned = spawn_worker(listeners, w, program, argv);
+                worker_pids[w] = respawned ? respawned.value() : -1;
+            }
+        }
+    }
+
+    for (pid_t pid : worker_pids) {
+        if (pid > 0) {
+            kill(pid, SIGTERM);
+        }
+    }
+    time_t deadline = time(nullptr) + drain_timeout_seconds;
+    for (pid_t pid : worker_pids) {
+        if (pid > 0) {
+            wait_process_until(pid, deadline);
+        }
+    }
+
+    stop_warmup();
+    close_listeners(listeners, !upgraded);
+    std::cout << "Sin conexiones en curso, terminando." << std::endl;
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+    auto args_result = parse_args(argc, argv);
+    if (!args_result) {
+        std::cerr << "Error al analizar argumentos: " << strerror(args_result.error()) << std::endl;
+        return args_result.error();
+    }
+
+    std::string program = executable_path(argv[0]);
+
+    auto signals_result = install_signal_handlers();
+    if (!signals_result) {
+        std::cerr << "Error al instalar los manejadores de señales: " << strerror(signals_result.error()) << std::endl;
+        return signals_result.error();
+    }
+
+    auto listeners_result = make_listeners();
+    if (!listeners_result) {
+        return listeners_result.error();
+    }
+    auto& listeners = listeners_result.value();
+    notify_upgrade_ready();
+
+    for (const auto& l : listeners) {
+        std::cout << "Escuchando en " << l.name << "..." << std::endl;
+    }
+
+    auto cache_result = prepare_listing_cache();
+    if (!cache_result) {
+        std::cerr << "Caché de listados desactivada (" << listing_cache_dir << "): " << strerror(cache_result.error()) << std::endl;
+        listing_cache_dir.clear();
+    }
+
+    if (!warmup_source.empty()) {
+        std::vector<int> listen_fds;
+        for (const auto& l : listeners) {
+            listen_fds.insert(listen_fds.end(), l.fds.begin(), l.fds.end());
+        }
+        auto warmup_result = start_warmup(listen_fds);
+        if (!warmup_result) {
+            std::cerr << "Error al iniciar la precarga: " << strerror(warmup_result.error()) << std::endl;
+        }
+    }
+
+    if (workers == 1) {
+        return serve(listeners, 0, true, program, argv);
+    }
+    return supervise(listeners, program, argv);
+}